@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+#include "codec.h"
+
+// The stream is a sequence of tokens. A control byte below 0x80 is followed
+// by (byte + 1) literal bytes; otherwise it is a match of ((byte & 0x7f) +
+// MIN_MATCH) bytes, copied from a little-endian 16 bit offset back.
+namespace {
+const size_t MIN_MATCH = 4;
+const size_t MAX_MATCH = 0x7f + MIN_MATCH;
+const size_t MAX_LITERAL = 0x80;
+const size_t MAX_OFFSET = 0xffff;
+const int HASH_BITS = 12;
+} // namespace
+
+string compress(const string& text) {
+    string packed;
+    vector<size_t> table(1 << HASH_BITS, string::npos);
+    size_t literal = 0; // start of the pending literal run
+    auto flush = [&](size_t end) {
+        while (literal < end) {
+            size_t count = min(end - literal, MAX_LITERAL);
+            packed += static_cast<char>(count - 1);
+            packed.append(text, literal, count);
+            literal += count;
+        }
+    };
+    size_t pos = 0;
+    while (pos + MIN_MATCH <= text.size()) {
+        uint32_t key;
+        memcpy(&key, text.data() + pos, sizeof key);
+        size_t slot = (key * 2654435761u) >> (32 - HASH_BITS);
+        size_t match = table[slot];
+        table[slot] = pos;
+        if (match == string::npos || pos - match > MAX_OFFSET ||
+            memcmp(text.data() + match, text.data() + pos, MIN_MATCH) != 0) {
+            ++pos;
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (pos + length < text.size() && length < MAX_MATCH &&
+               text[match + length] == text[pos + length])
+            ++length;
+        flush(pos);
+        size_t offset = pos - match;
+        packed += static_cast<char>(0x80 | (length - MIN_MATCH));
+        packed += static_cast<char>(offset & 0xff);
+        packed += static_cast<char>(offset >> 8);
+        pos += length;
+        literal = pos;
+    }
+    flush(text.size());
+    return packed;
+}
+
+string decompress(const string& packed, size_t size) {
+    string text;
+    text.reserve(size);
+    size_t pos = 0;
+    while (pos < packed.size()) {
+        unsigned char control = packed[pos++];
+        if (control < 0x80) {
+            text.append(packed, pos, control + 1);
+            pos += control + 1;
+            continue;
+        }
+        size_t length = (control & 0x7f) + MIN_MATCH;
+        size_t offset = static_cast<unsigned char>(packed[pos]) |
+                        static_cast<unsigned char>(packed[pos + 1]) << 8;
+        pos += 2;
+        // byte by byte, since a match may overlap the bytes it produces
+        for (size_t from = text.size() - offset; length > 0; --length)
+            text += text[from++];
+    }
+    return text;
+}
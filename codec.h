@@ -0,0 +1,25 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <string>
+using namespace std;
+
+/**
+ * @brief compresses a string with a small byte-oriented LZ77 codec; fast
+ * rather than tight, meant for keeping cold file contents in memory
+ *
+ * @param text the string to compress
+ * @return string the compressed bytes
+ */
+string compress(const string& text);
+
+/**
+ * @brief reverses compress
+ *
+ * @param packed bytes produced by compress
+ * @param size length of the original string, used to size the result
+ * @return string the original string
+ */
+string decompress(const string& packed, size_t size);
+
+#endif
@@ -4,7 +4,11 @@ const cmd_hash cmd_map{
     {"cat", fn_cat},       {"cd", fn_cd},     {"echo", fn_echo},
     {"ls", fn_ls},         {"make", fn_make}, {"mkdir", fn_mkdir},
     {"prompt", fn_prompt}, {"pwd", fn_pwd},   {"rm", fn_rm},
-    {"exit", fn_exit},     {"help", fn_help}, {"touch", fn_touch}};
+    {"exit", fn_exit},     {"help", fn_help}, {"touch", fn_touch},
+    {"mv", fn_mv},         {"ln", fn_ln},     {"memstat", fn_memstat},
+    {"dedup", fn_dedup},   {"budget", fn_budget},
+    {"watch", fn_watch},   {"unwatch", fn_unwatch},
+    {"events", fn_events}};
 
 cmd_fn find_cmd_fn(const string& cmd) {
     const auto result = cmd_map.find(cmd);
@@ -42,19 +46,88 @@ base_file_ptr resolve_path(const string& cmd, inode_ptr cwd,
     return cwd->get_contents();
 }
 
+/**
+ * @brief checks whether an inode holds a directory
+ *
+ * @param node pointer to the inode
+ * @return true if node is a directory, false if it is a plain_file
+ */
+bool is_dir(const inode_ptr& node) {
+    try {
+        node->get_contents()->get_dirents();
+        return true;
+    } catch (file_error&) {
+        return false;
+    }
+}
+
+/**
+ * @brief resolves the destination of mv or ln; like mv(1), a destination that
+ * names an existing directory means "inside that directory"
+ *
+ * @param cmd command from which the function was called
+ * @param state the shell state
+ * @param path the destination path
+ * @param name entry name to use when moving into a directory
+ * @return tuple of the directory to link into, the new entry name, and
+ * whether path named that directory rather than the new entry
+ */
+tuple<base_file_ptr, string, bool> resolve_dest(const string& cmd,
+                                                const inode_state& state,
+                                                const vector<string>& path,
+                                                const string& name) {
+    if (path.size() == 0) // destination is "/"
+        return {state.get_root()->get_contents(), name, true};
+    base_file_ptr dest_dir = resolve_path(cmd, state.get_cwd(), path);
+    auto it = dest_dir->get_dirents().find(path.back());
+    if (it != dest_dir->get_dirents().end() && is_dir(it->second))
+        return {it->second->get_contents(), name, true};
+    return {dest_dir, path.back(), false};
+}
+
+/**
+ * @brief turns a path relative to the cwd into an absolute one, using the
+ * cached cwd path rather than searching any directory
+ *
+ * @param state the shell state
+ * @param path a path relative to the cwd, possibly with '.' and '..'
+ * @return vector<string> the names from the root down
+ */
+vector<string> absolute_path(const inode_state& state,
+                             const vector<string>& path) {
+    vector<string> result = state.get_cwd_path();
+    for (const string& name : path) {
+        if (name == "..") {
+            if (result.size() > 0) // the root is its own parent
+                result.pop_back();
+        } else if (name != ".") {
+            result.push_back(name);
+        }
+    }
+    return result;
+}
+
 /**
  * @brief a print function for ls
  *
  * @param path path of directory being printed
- * @param dir reference to the directory entries
+ * @param dir stream over the directory entries, positioned at the first entry
+ * to print
+ * @param limit maximum number of entries to print
  */
-void print_ls(const string& path, const ptr_map& dir) {
+void print_ls(const string& path, dir_stream& dir,
+              size_t limit = numeric_limits<size_t>::max()) {
     if (path.size() == 0)
         cout << "/:" << endl;
     else
         cout << path << ":" << endl;
-    for (const auto& [filename, node] : dir) {
+    for (; limit > 0; --limit) {
+        const auto* entry = dir.readdir();
+        if (entry == nullptr)
+            break;
+        const auto& [filename, node] = *entry;
         cout << setw(6) << node->get_inode_num();
+        cout << setw(4) << node->get_links();
         cout << setw(6) << node->get_contents()->size();
         try {
             node->get_contents()->get_dirents();
@@ -70,18 +143,19 @@ void print_ls(const string& path, const ptr_map& dir) {
  * pre-order
  *
  * @param path path to directory
- * @param dir reference to the directory entries
+ * @param dir_node pointer to the directory
  */
-void ls_recurse(const string& path, const ptr_map& dir) {
+void ls_recurse(const string& path, inode_ptr dir_node) {
+    dir_stream dir(dir_node);
     print_ls(path, dir);
-    if (dir.size() == 2)
+    const ptr_map& dirents = dir_node->get_contents()->get_dirents();
+    if (dirents.size() == 2)
         return;
-    for (const auto& [filename, node] : dir) {
+    for (const auto& [filename, node] : dirents) {
         try {
             node->get_contents()->get_dirents();
             if (filename != "." && filename != "..")
-                ls_recurse(path + "/" + filename,
-                           node->get_contents()->get_dirents());
+                ls_recurse(path + "/" + filename, node);
         } catch (file_error&) { // plain_file
         }
     }
@@ -109,11 +183,17 @@ void rm_recurse(base_file_ptr dir) {
             }
         }
     }
-    // then delete all directories and files
+    // then delete all directories and files, keeping '.' and '..' until last
+    // so that watches can still see where the removals happened
     for (auto it = dir->get_dirents().begin();
          it != dir->get_dirents().end();) {
-        dir->remove(it++, true);
+        if (it->first == "." || it->first == "..")
+            ++it;
+        else
+            dir->remove(it++, true);
     }
+    dir->remove(dir->get_dirents().find("."), true);
+    dir->remove(dir->get_dirents().find(".."), true);
 }
 } // namespace
 
@@ -122,14 +202,17 @@ void rm_recurse(base_file_ptr dir) {
 // ---------------------
 void fn_cat(inode_state& state, const vector<string>& words) {
     for (size_t i = 1; i < words.size(); ++i) {
+        inode_ptr file;
         try {
-            inode_ptr file =
-                state.get_cwd()->get_contents()->get_dirents().at(words[i]);
+            file = state.get_cwd()->get_contents()->get_dirents().at(words[i]);
             cout << join(file->get_contents()->readfile(), " ") << endl;
         } catch (out_of_range&) {
             throw command_error(words[0] + ": " + words[i] +
                                 ": No such file or directory");
-        } catch (file_error&) {
+        } catch (file_error& error) {
+            if (!is_dir(file)) // contents could not be faulted back in
+                throw command_error(words[0] + ": " + words[i] + ": " +
+                                    error.what());
             throw command_error(words[0] + ": " + words[i] +
                                 ": Is a directory");
         }
@@ -166,51 +249,65 @@ void fn_echo(inode_state&, const vector<string>& words) {
 }
 
 void fn_ls(inode_state& state, const vector<string>& words) {
-    vector<string> path;
+    const string usage =
+        words[0] + ": Usage: ls [-r] [--limit N] [--after name] /path/to/file";
+    string pathname;
+    string after;
+    size_t limit = numeric_limits<size_t>::max();
     bool recur = false;
+    bool paged = false;
     // parse arguments
-    if (words.size() == 1) {
-        print_ls(state.cwd_str(),
-                 state.get_cwd()->get_contents()->get_dirents());
-        return;
-    } else if (words.size() == 2) {
-        if (words[1] == "-r")
+    for (size_t i = 1; i < words.size(); ++i) {
+        if (words[i] == "-r") {
             recur = true;
-        else
-            path = split(words[1], "/");
-    } else if (words.size() == 3) {
-        if (words[1] != "-r")
-            throw command_error(words[0] + ": Usage: ls [-r] /path/to/file");
-        recur = true;
-        path = split(words[2], "/");
-    } else {
-        throw command_error(words[0] + ": Too many arguments");
+        } else if (words[i] == "--limit" || words[i] == "--after") {
+            if (i + 1 == words.size())
+                throw command_error(usage);
+            paged = true;
+            if (words[i] == "--after") {
+                after = words[++i];
+                continue;
+            }
+            try {
+                size_t pos = 0;
+                limit = stoul(words[++i], &pos);
+                if (words[i][0] == '-' || pos != words[i].size())
+                    throw invalid_argument(words[i]);
+            } catch (logic_error&) {
+                throw command_error(words[0] + ": " + words[i] +
+                                    ": invalid limit");
+            }
+        } else if (pathname.empty()) {
+            pathname = words[i];
+        } else {
+            throw command_error(words[0] + ": Too many arguments");
+        }
     }
+    if (recur && paged)
+        throw command_error(words[0] + ": -r cannot be combined with paging");
+    vector<string> path = split(pathname, "/");
     if (path.size() == 0) {
         // ls with no args, proceed with cwd dirents
-        if (recur)
-            ls_recurse("", state.get_cwd()->get_contents()->get_dirents());
-        else
-            print_ls(state.cwd_str(),
-                     state.get_cwd()->get_contents()->get_dirents());
+        if (recur) {
+            ls_recurse("", state.get_cwd());
+        } else {
+            dir_stream dir(state.get_cwd(), after);
+            print_ls(state.cwd_str(), dir, limit);
+        }
     } else {
         base_file_ptr parent_dir = resolve_path("ls", state.get_cwd(), path);
         try {
-            // get reference to requested directory
-            const ptr_map& dir = parent_dir->get_dirents()
-                                     .at(path.back())
-                                     ->get_contents()
-                                     ->get_dirents();
-            if (recur)
-                ls_recurse(state.cwd_str() + words[2] + "/", dir);
-            else
-                print_ls(state.cwd_str() + words[1], dir);
+            // get pointer to requested directory
+            inode_ptr dir_node = parent_dir->get_dirents().at(path.back());
+            if (recur) {
+                ls_recurse(state.cwd_str() + pathname + "/", dir_node);
+            } else {
+                dir_stream dir(dir_node, after);
+                print_ls(state.cwd_str() + pathname, dir, limit);
+            }
         } catch (file_error&) {
             // file is a plain_file, print out path
-            if (recur)
-                cout << words[2] << endl;
-            else
-                cout << words[1] << endl;
+            cout << pathname << endl;
         } catch (out_of_range&) {
             throw command_error(words[0] + ": " + path.back() +
                                 ": No such file or directory");
@@ -224,7 +321,12 @@ void fn_make(inode_state& state, const vector<string>& words) {
     if (words[1][0] < '.')
         throw command_error(words[0] + ": files cannot begin with \'" +
                             words[1][0] + "\'");
-    inode_ptr new_file = state.get_cwd()->get_contents()->mkfile(words[1]);
+    inode_ptr new_file;
+    try {
+        new_file = state.get_cwd()->get_contents()->mkfile(words[1]);
+    } catch (file_error&) {
+        throw command_error(words[0] + ": " + words[1] + ": Is a directory");
+    }
     new_file->get_contents()->writefile(words);
 }
 
@@ -235,8 +337,83 @@ void fn_mkdir(inode_state& state, const vector<string>& words) {
         throw command_error(words[0] +
                             ": directory names cannot begin with \'" +
                             words[1][0] + "\'");
-    for (auto it = words.cbegin() + 1; it != words.cend(); ++it)
-        state.get_cwd()->get_contents()->mkdir(*it);
+    for (auto it = words.cbegin() + 1; it != words.cend(); ++it) {
+        try {
+            state.get_cwd()->get_contents()->mkdir(*it);
+        } catch (file_error&) {
+            throw command_error(words[0] + ": " + *it + ": File exists");
+        }
+    }
+}
+
+void fn_mv(inode_state& state, const vector<string>& words) {
+    if (words.size() != 3)
+        throw command_error(words[0] + ": Usage: mv source dest");
+    vector<string> src_path = split(words[1], "/");
+    if (src_path.size() == 0 || src_path.back() == "." ||
+        src_path.back() == "..")
+        throw command_error(words[0] + ": " + words[1] + ": may not be moved");
+    base_file_ptr src_dir = resolve_path("mv", state.get_cwd(), src_path);
+    auto src = src_dir->get_dirents().find(src_path.back());
+    if (src == src_dir->get_dirents().end())
+        throw command_error(words[0] + ": " + src_path.back() +
+                            ": No such file or directory");
+    inode_ptr node = src->second;
+    vector<string> dest_path = split(words[2], "/");
+    auto [dest_dir, new_name, into_dir] =
+        resolve_dest("mv", state, dest_path, src->first);
+    if (is_dir(node)) {
+        // a directory may not be moved below itself
+        inode_ptr up = dest_dir->get_dirents().at(".");
+        while (up != node && up != state.get_root())
+            up = up->get_contents()->get_dirents().at("..");
+        if (up == node)
+            throw command_error(words[0] + ": " + words[1] +
+                                ": cannot move a directory into itself");
+    }
+    auto dest = dest_dir->get_dirents().find(new_name);
+    if (dest != dest_dir->get_dirents().end()) {
+        if (dest->second == node)
+            return; // same file, nothing to do
+        if (is_dir(node) || is_dir(dest->second))
+            throw command_error(words[0] + ": " + new_name + ": File exists");
+        dest_dir->remove(dest, false); // replace the existing plain_file
+    }
+    src_dir->rename(src, dest_dir, new_name);
+    if (is_dir(node)) {
+        // "/" is the only destination not relative to the cwd
+        vector<string> moved_path;
+        if (dest_path.size() > 0)
+            moved_path = absolute_path(state, dest_path);
+        if (into_dir)
+            moved_path.push_back(new_name);
+        state.cwd_relink(node, moved_path);
+    }
+}
+
+void fn_ln(inode_state& state, const vector<string>& words) {
+    if (words.size() != 3)
+        throw command_error(words[0] + ": Usage: ln target linkname");
+    vector<string> target_path = split(words[1], "/");
+    if (target_path.size() == 0)
+        throw command_error(words[0] + ": " + words[1] +
+                            ": hard link not allowed for directory");
+    base_file_ptr target_dir =
+        resolve_path("ln", state.get_cwd(), target_path);
+    auto target = target_dir->get_dirents().find(target_path.back());
+    if (target == target_dir->get_dirents().end())
+        throw command_error(words[0] + ": " + target_path.back() +
+                            ": No such file or directory");
+    if (is_dir(target->second))
+        throw command_error(words[0] + ": " + words[1] +
+                            ": hard link not allowed for directory");
+    auto [dest_dir, name, into_dir] =
+        resolve_dest("ln", state, split(words[2], "/"), target->first);
+    try {
+        dest_dir->link(name, target->second);
+    } catch (file_error&) {
+        throw command_error(words[0] + ": " + name + ": File exists");
+    }
 }
 
 void fn_prompt(inode_state& state, const vector<string>& words) {
@@ -279,27 +456,188 @@ void fn_rm(inode_state& state, const vector<string>& words) {
     parent_dir->remove(it, recur);
 }
 
+void fn_memstat(inode_state&, const vector<string>&) {
+    const blob_store& store = blob_store::get();
+    size_t logical = store.logical_bytes();
+    size_t stored = store.stored_bytes();
+    cout << "blobs: " << store.blob_count() << endl;
+    cout << "logical bytes: " << logical << endl;
+    cout << "stored bytes: " << stored << endl;
+    const ios::fmtflags flags = cout.flags();
+    const streamsize precision = cout.precision();
+    cout << "dedup ratio: " << fixed << setprecision(2)
+         << (stored == 0 ? 1.0 : static_cast<double>(logical) / stored) << endl;
+    cout.flags(flags);
+    cout.precision(precision);
+    cout << "resident bytes: " << store.get_resident_bytes() << endl;
+    cout << "compressed bytes: " << store.get_compressed_bytes() << endl;
+    cout << "spilled bytes: " << store.get_spilled_bytes() << endl;
+}
+
+void fn_budget(inode_state&, const vector<string>& words) {
+    if (words.size() > 3)
+        throw command_error(words[0] + ": Too many arguments");
+    blob_store& store = blob_store::get();
+    if (words.size() > 1) {
+        // a missing or "none" limit means unlimited
+        size_t limits[2] = {numeric_limits<size_t>::max(),
+                            numeric_limits<size_t>::max()};
+        for (size_t i = 1; i < words.size(); ++i) {
+            if (words[i] == "none")
+                continue;
+            try {
+                size_t pos = 0;
+                limits[i - 1] = stoul(words[i], &pos);
+                if (words[i][0] == '-' || pos != words[i].size())
+                    throw invalid_argument(words[i]);
+            } catch (logic_error&) {
+                throw command_error(words[0] + ": " + words[i] +
+                                    ": invalid budget");
+            }
+        }
+        store.set_budget(limits[0], limits[1]);
+    }
+    const size_t budgets[2] = {store.get_resident_budget(),
+                               store.get_compressed_budget()};
+    const char* names[2] = {"resident budget: ", "compressed budget: "};
+    for (size_t i = 0; i < 2; ++i) {
+        cout << names[i];
+        if (budgets[i] == numeric_limits<size_t>::max())
+            cout << "none" << endl;
+        else
+            cout << budgets[i] << endl;
+    }
+}
+
+void fn_dedup(inode_state&, const vector<string>& words) {
+    if (words.size() > 2)
+        throw command_error(words[0] + ": Usage: dedup [on|off]");
+    if (words.size() == 2) {
+        if (words[1] == "on")
+            blob_store::get().set_dedup(true);
+        else if (words[1] == "off")
+            blob_store::get().set_dedup(false);
+        else
+            throw command_error(words[0] + ": Usage: dedup [on|off]");
+    }
+    cout << "dedup " << (blob_store::get().get_dedup() ? "on" : "off")
+         << endl;
+}
+
+void fn_watch(inode_state& state, const vector<string>& words) {
+    watch_hub& hub = watch_hub::get();
+    if (words.size() == 1) {
+        // list the active watches
+        for (size_t id : hub.list()) {
+            cout << setw(6) << id;
+            cout << setw(6) << hub.get_target_inode_num(id);
+            cout << (hub.is_recursive(id) ? "  -r" : "") << endl;
+        }
+        return;
+    }
+    bool recur = false;
+    string pathname;
+    if (words.size() == 2) {
+        if (words[1] == "-r")
+            recur = true;
+        else
+            pathname = words[1];
+    } else if (words.size() == 3) {
+        if (words[1] != "-r")
+            throw command_error(words[0] + ": Usage: watch [-r] [pathname]");
+        recur = true;
+        pathname = words[2];
+    } else {
+        throw command_error(words[0] + ": Too many arguments");
+    }
+    inode_ptr target = state.get_cwd();
+    vector<string> path = split(pathname, "/");
+    if (path.size() > 0) {
+        base_file_ptr parent_dir = resolve_path("watch", state.get_cwd(), path);
+        auto it = parent_dir->get_dirents().find(path.back());
+        if (it == parent_dir->get_dirents().end())
+            throw command_error(words[0] + ": " + path.back() +
+                                ": No such file or directory");
+        target = it->second;
+    } else if (!pathname.empty()) { // pathname is "/"
+        target = state.get_root();
+    }
+    cout << "watch " << hub.subscribe(target, recur) << endl;
+}
+
+void fn_unwatch(inode_state&, const vector<string>& words) {
+    if (words.size() == 1)
+        throw command_error(words[0] + ": must specify a watch number");
+    for (auto it = words.cbegin() + 1; it != words.cend(); ++it) {
+        try {
+            size_t pos = 0;
+            size_t id = stoul(*it, &pos);
+            if (pos != it->size())
+                throw invalid_argument(*it);
+            watch_hub::get().unsubscribe(id);
+        } catch (logic_error&) {
+            throw command_error(words[0] + ": " + *it + ": no such watch");
+        }
+    }
+}
+
+void fn_events(inode_state&, const vector<string>&) {
+    watch_hub& hub = watch_hub::get();
+    for (size_t id : hub.list()) {
+        fs_event event;
+        while (hub.poll(id, event)) {
+            cout << setw(6) << id;
+            cout << "  " << left << setw(6) << event_name(event.kind) << right;
+            cout << setw(6) << event.dir_inode_num;
+            cout << "  " << event.name << endl;
+        }
+        // checked after draining, so a burst that overflowed is reported
+        // once its surviving events have been printed
+        if (hub.take_overflow(id))
+            cout << setw(6) << id << "  overflow: events were lost" << endl;
+    }
+}
+
 void fn_exit(inode_state&, const vector<string>&) { throw shell_exit(); }
 
 void fn_touch(inode_state& state, const vector<string>& words) {
-    for (auto it = words.cbegin() + 1; it != words.cend(); ++it)
-        fn_make(state, {words[0], *it});
+    for (auto it = words.cbegin() + 1; it != words.cend(); ++it) {
+        if ((*it)[0] < '.')
+            throw command_error(words[0] + ": files cannot begin with \'" +
+                                (*it)[0] + "\'");
+        try {
+            // an existing file is left as it is
+            state.get_cwd()->get_contents()->mkfile(*it);
+        } catch (file_error&) {
+            throw command_error(words[0] + ": " + *it + ": Is a directory");
+        }
+    }
 }
 
 void fn_help(inode_state&, const vector<string>&) {
     const char help_msg[] = R"(
+    budget [res [comp]]     - Limit bytes of resident and compressed files
     cat pathname            - Print the contents of one or several files
     cd [pathname]           - Change directory
+    dedup [on|off]          - Share storage between identical files (off)
     echo [text]             - Echo text
+    events                  - Print and clear pending watch events
     exit                    - Exit the shell
     help                    - Print this message
+    ln target linkname      - Create a hard link to a file
     ls [-r] [pathname]      - Print the contents of a directory
-    make pathname [text]    - Create a file with optional contents
+       [--limit N]          - Print at most N entries
+       [--after name]       - Resume the listing after entry 'name'
+    make pathname [text]    - Create or overwrite a file
+    memstat                 - Print file storage and memory statistics
     mkdir pathname          - Create a directory
+    mv source dest          - Move or rename a file or directory
     prompt text             - Change the shell prompt
     pwd                     - Print the current working directory
     rm [-r] pathname        - Remove a file or directory
     touch pathname          - Create an empty file
+    unwatch number          - Remove a watch
+    watch [-r] [pathname]   - Watch a file or directory for changes
     )";
     cout << help_msg << endl;
 }
@@ -1,10 +1,13 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
+#include <limits>
+#include <tuple>
 #include <unordered_map>
 using namespace std;
 
 #include "file_sys.h"
+#include "notify.h"
 #include "util.h"
 
 using cmd_fn = void (*)(inode_state& state, const vector<string>& words);
@@ -40,13 +43,14 @@ void fn_echo(inode_state& state, const vector<string>& words);
  * @brief prints the contents of a directory (and its subdirectories if -r is
  * present)
  *
- * @param words words[1] should be either a pathname or '-r'; if '-r' is
- * present, words[2] should be a pathname
+ * @param words optional '-r', optional '--limit N' and '--after name' to page
+ * through a large directory, and an optional pathname, in any order; paging
+ * cannot be combined with '-r'
  */
 void fn_ls(inode_state& state, const vector<string>& words);
 
 /**
- * @brief creates a text file
+ * @brief creates a text file, replacing the contents of an existing one
  *
  * @param words words[1] is the name of the file, words[2..words.size()-1] is
  * the contents of the file
@@ -60,6 +64,21 @@ void fn_make(inode_state& state, const vector<string>& words);
  */
 void fn_mkdir(inode_state& state, const vector<string>& words);
 
+/**
+ * @brief moves or renames a file or directory without copying it
+ *
+ * @param words words[1] is the source pathname, words[2] is the destination;
+ * if the destination is an existing directory the source is moved into it
+ */
+void fn_mv(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief creates a hard link to a plain file
+ *
+ * @param words words[1] is the target pathname, words[2] is the new link name
+ */
+void fn_ln(inode_state& state, const vector<string>& words);
+
 /**
  * @brief changes the prompt of the shell
  *
@@ -81,6 +100,54 @@ void fn_pwd(inode_state& state, const vector<string>& words);
  */
 void fn_rm(inode_state& state, const vector<string>& words);
 
+/**
+ * @brief prints how many bytes of file contents are stored versus how many
+ * the files would hold without deduplication, and how many are resident,
+ * compressed and spilled
+ *
+ */
+void fn_memstat(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief turns content-addressed deduplication of file contents on or off
+ * (it starts off); existing files are unaffected until they are next written
+ *
+ * @param words words[1] is optionally "on" or "off"
+ */
+void fn_dedup(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief sets the memory budget for file contents; cold files beyond the
+ * resident budget are compressed, and compressed files beyond the compressed
+ * budget are spilled to a temporary file
+ *
+ * @param words words[1] is the resident budget in bytes, words[2] the
+ * compressed budget; either may be "none" or omitted for no limit
+ */
+void fn_budget(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief watches a file or directory (and its subdirectories if -r is
+ * present) for changes, or lists the active watches if given no arguments
+ *
+ * @param words words[1] should be either a pathname or '-r'; if '-r' is
+ * present, words[2] should be a pathname
+ */
+void fn_watch(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief removes one or more watches
+ *
+ * @param words words[1..words.size()-1] are watch numbers
+ */
+void fn_unwatch(inode_state& state, const vector<string>& words);
+
+/**
+ * @brief prints and clears the pending events of every watch
+ *
+ */
+void fn_events(inode_state& state, const vector<string>& words);
+
 /**
  * @brief exits the program
  * 
@@ -94,7 +161,7 @@ void fn_exit(inode_state& state, const vector<string>& words);
 void fn_help(inode_state& state, const vector<string>& words);
 
 /**
- * @brief create a new empty file
+ * @brief create a new empty file; an existing file is left unchanged
  * 
  * @param words words[1] is the filename
  */
@@ -1,18 +1,21 @@
 #include <cassert>
+#include <functional>
 #include <iostream>
 #include <stdexcept>
 
 using namespace std;
 
+#include "codec.h"
 #include "file_sys.h"
+#include "notify.h"
 
 size_t inode::next_inode_num = 1;
 
 inode_state::inode_state() {
     root = make_shared<inode>(file_type::DIRECTORY_TYPE);
     cwd = root;
-    root->get_contents()->get_dirents().emplace(".", root);
-    root->get_contents()->get_dirents().emplace("..", root);
+    root->get_contents()->link(".", root);
+    root->get_contents()->link("..", root);
 }
 
 const string& inode_state::get_prompt() const { return prompt; };
@@ -34,6 +37,21 @@ void inode_state::cwd_pop(bool empty) {
         path.pop_back(); // move up one level
 }
 
+void inode_state::cwd_relink(inode_ptr moved, const vector<string>& new_path) {
+    // find how far below the moved directory the cwd sits, if at all
+    size_t depth = 0;
+    for (inode_ptr node = cwd; node != moved; ++depth) {
+        if (node == root)
+            return; // cwd is outside the moved subtree
+        node = node->get_contents()->get_dirents().at("..");
+    }
+    vector<string> names(path.end() - depth, path.end());
+    path = new_path;
+    path.insert(path.end(), names.begin(), names.end());
+}
+
+const vector<string>& inode_state::get_cwd_path() const { return path; }
+
 const string inode_state::cwd_str() const { return "/" + join(path, "/"); }
 
 inode::inode(file_type type) : inode_num(next_inode_num++) {
@@ -51,6 +69,12 @@ inode::inode(file_type type) : inode_num(next_inode_num++) {
 
 size_t inode::get_inode_num() const { return inode_num; }
 
+size_t inode::get_links() const { return links; }
+
+void inode::add_link() { ++links; }
+
+void inode::drop_link() { --links; }
+
 base_file_ptr inode::get_contents() const { return contents; }
 
 file_error::file_error(const string& what) : runtime_error(what) {}
@@ -68,6 +92,14 @@ void base_file::remove(const ptr_map::iterator, bool) {
     throw file_error("is a " + error_file_type());
 }
 
+void base_file::link(const string&, inode_ptr) {
+    throw file_error("is a " + error_file_type());
+}
+
+void base_file::rename(const ptr_map::iterator, base_file_ptr, const string&) {
+    throw file_error("is a " + error_file_type());
+}
+
 inode_ptr base_file::mkdir(const string&) {
     throw file_error("is a " + error_file_type());
 }
@@ -80,21 +112,273 @@ ptr_map& base_file::get_dirents() {
     throw file_error("is a " + error_file_type());
 }
 
-size_t plain_file::size() const {
-    size_t size = 0;
-    for (const string& word : data)
-        size += word.size(); // size of all words
-    if (data.size() > 0)
-        size += data.size() - 1; // plus all spaces
-    return size;
+blob::blob(vector<string>&& new_words, size_t words_hash)
+    : words(move(new_words)), hash(words_hash) {
+    for (const string& word : words)
+        bytes += word.size(); // size of all words
+    if (words.size() > 0)
+        bytes += words.size() - 1; // plus all spaces
+}
+
+blob::~blob() {
+    if (indexed)
+        blob_store::get().forget(this);
+}
+
+const vector<string>& blob::get_words() const {
+    referenced = true;
+    if (state != residency::RESIDENT)
+        blob_store::get().fault_in(this);
+    return words;
+}
+
+size_t blob::get_hash() const { return hash; }
+
+size_t blob::get_bytes() const { return bytes; }
+
+blob_store& blob_store::get() {
+    static blob_store store;
+    return store;
 }
 
-const vector<string>& plain_file::readfile() const { return data; }
+blob_ptr blob_store::empty() {
+    // shared by every empty file, and kept out of the index and the budget
+    static const blob_ptr none = make_shared<blob>(vector<string>{}, 0);
+    return none;
+}
+
+blob_ptr blob_store::intern(vector<string>&& words) {
+    if (words.empty())
+        return empty();
+    size_t hash = words.size();
+    for (const string& word : words) // boost::hash_combine
+        hash ^= std::hash<string>{}(word) + 0x9e3779b9 + (hash << 6) +
+                (hash >> 2);
+    if (dedup) {
+        auto [first, last] = blobs.equal_range(hash);
+        for (auto it = first; it != last; ++it)
+            if (it->second->get_words() == words)
+                return it->second->shared_from_this();
+    }
+    auto new_blob = make_shared<blob>(move(words), hash);
+    new_blob->indexed = true;
+    blobs.emplace(hash, new_blob.get());
+    new_blob->list_pos = clock.insert(hand, new_blob.get());
+    resident_bytes += new_blob->bytes;
+    enforce_budget(new_blob.get());
+    return new_blob;
+}
+
+void blob_store::forget(const blob* old_blob) {
+    auto [first, last] = blobs.equal_range(old_blob->get_hash());
+    for (auto it = first; it != last; ++it) {
+        if (it->second == old_blob) {
+            blobs.erase(it);
+            break;
+        }
+    }
+    if (old_blob->state == residency::RESIDENT && hand == old_blob->list_pos)
+        ++hand;
+    list_for(old_blob->state).erase(old_blob->list_pos);
+    switch (old_blob->state) {
+    case residency::RESIDENT:
+        resident_bytes -= old_blob->bytes;
+        break;
+    case residency::COMPRESSED:
+        compressed_bytes -= old_blob->packed_size;
+        break;
+    case residency::SPILLED:
+        spilled_bytes -= old_blob->packed_size;
+        break;
+    }
+    if (old_blob->spill_offset >= 0)
+        release_extent(old_blob->spill_offset, old_blob->packed_size);
+}
+
+void blob_store::fault_in(const blob* cold) {
+    if (cold->state == residency::SPILLED) {
+        cold->packed.resize(cold->packed_size);
+        if (fseek(spill_file.get(), cold->spill_offset, SEEK_SET) != 0 ||
+            fread(cold->packed.data(), 1, cold->packed_size,
+                  spill_file.get()) != cold->packed_size) {
+            string().swap(cold->packed);
+            throw file_error("cannot read spill file");
+        }
+        spilled_bytes -= cold->packed_size;
+    } else {
+        compressed_bytes -= cold->packed_size;
+    }
+    cold->words = split(decompress(cold->packed, cold->bytes), " ");
+    string().swap(cold->packed);
+    resident_bytes += cold->bytes;
+    set_state(cold, residency::RESIDENT);
+    enforce_budget(cold);
+}
+
+list<const blob*>& blob_store::list_for(residency state) {
+    switch (state) {
+    case residency::RESIDENT:
+        return clock;
+    case residency::COMPRESSED:
+        return packed_blobs;
+    default:
+        return spilled_blobs;
+    }
+}
+
+void blob_store::set_state(const blob* changed, residency state) {
+    if (changed->state == residency::RESIDENT && hand == changed->list_pos)
+        ++hand;
+    // a blob faulted back in goes just behind the hand, so it is swept last
+    list<const blob*>& to = list_for(state);
+    to.splice(state == residency::RESIDENT ? hand : to.end(),
+              list_for(changed->state), changed->list_pos);
+    changed->state = state;
+}
+
+const blob* blob_store::advance_hand() {
+    if (hand == clock.end())
+        hand = clock.begin();
+    return *hand++;
+}
+
+void blob_store::pack(const blob* cold) {
+    // words never contain spaces, since they come from split(line, " \t")
+    cold->packed = compress(join(cold->words, " "));
+    cold->packed_size = cold->packed.size();
+    vector<string>().swap(cold->words);
+    resident_bytes -= cold->bytes;
+    compressed_bytes += cold->packed_size;
+    set_state(cold, residency::COMPRESSED);
+}
+
+long blob_store::claim_extent(size_t size) {
+    // best fit from the free list, else the end of the spill file
+    auto extent = free_extents.lower_bound(size);
+    if (extent != free_extents.end()) {
+        auto [extent_size, offset] = *extent;
+        free_extents.erase(extent);
+        release_extent(offset + static_cast<long>(size), extent_size - size);
+        return offset;
+    }
+    if (spill_file == nullptr)
+        spill_file.reset(tmpfile());
+    if (spill_file == nullptr || fseek(spill_file.get(), 0, SEEK_END) != 0)
+        return -1;
+    return ftell(spill_file.get());
+}
+
+void blob_store::release_extent(long offset, size_t size) {
+    if (size > 0)
+        free_extents.emplace(size, offset);
+}
+
+bool blob_store::spill(const blob* cold) {
+    // blobs are immutable and compress is deterministic, so a blob that was
+    // spilled before is still on disk and needs no second write
+    if (cold->spill_offset < 0) {
+        long offset = claim_extent(cold->packed_size);
+        // if the spill file is unusable, the blob just stays compressed
+        if (offset < 0)
+            return false;
+        if (fseek(spill_file.get(), offset, SEEK_SET) != 0 ||
+            fwrite(cold->packed.data(), 1, cold->packed_size,
+                   spill_file.get()) != cold->packed_size) {
+            release_extent(offset, cold->packed_size);
+            return false;
+        }
+        cold->spill_offset = offset;
+    }
+    string().swap(cold->packed);
+    compressed_bytes -= cold->packed_size;
+    spilled_bytes += cold->packed_size;
+    set_state(cold, residency::SPILLED);
+    return true;
+}
+
+void blob_store::enforce_budget(const blob* pinned) {
+    // CLOCK over resident blobs only: a referenced blob gets a second chance,
+    // and once only the pinned blob is left there is nothing more to free
+    size_t keep =
+        pinned != nullptr && pinned->state == residency::RESIDENT ? 1 : 0;
+    while (resident_bytes > resident_budget && clock.size() > keep) {
+        const blob* cold = advance_hand();
+        if (cold == pinned)
+            continue;
+        if (cold->referenced)
+            cold->referenced = false;
+        else
+            pack(cold);
+    }
+    while (compressed_bytes > compressed_budget && !packed_blobs.empty())
+        if (!spill(packed_blobs.front()))
+            break; // the spill file is unusable
+}
+
+bool blob_store::get_dedup() const { return dedup; }
+
+void blob_store::set_dedup(bool enabled) { dedup = enabled; }
+
+void blob_store::set_budget(size_t resident, size_t compressed) {
+    resident_budget = resident;
+    compressed_budget = compressed;
+    enforce_budget(nullptr);
+}
+
+size_t blob_store::get_resident_budget() const { return resident_budget; }
+
+size_t blob_store::get_compressed_budget() const { return compressed_budget; }
+
+size_t blob_store::blob_count() const { return blobs.size(); }
+
+size_t blob_store::stored_bytes() const {
+    size_t bytes = 0;
+    for (const auto& [hash, stored] : blobs)
+        bytes += stored->get_bytes();
+    return bytes;
+}
+
+size_t blob_store::logical_bytes() const {
+    size_t bytes = 0;
+    for (const auto& [hash, stored] : blobs)
+        bytes += stored->get_bytes() * stored->weak_from_this().use_count();
+    return bytes;
+}
+
+size_t blob_store::get_resident_bytes() const { return resident_bytes; }
+
+size_t blob_store::get_compressed_bytes() const { return compressed_bytes; }
+
+size_t blob_store::get_spilled_bytes() const { return spilled_bytes; }
+
+plain_file::plain_file() : data(blob_store::empty()) {}
+
+size_t plain_file::size() const { return data->get_bytes(); }
+
+const vector<string>& plain_file::readfile() const {
+    return data->get_words();
+}
 
 void plain_file::writefile(const vector<string>& new_data) {
     // new_data[0]==cmd, new_data[1]==filename
-    for (size_t i = 2; i < new_data.size(); ++i)
-        data.push_back(new_data[i]);
+    auto first = new_data.cbegin() + min<size_t>(2, new_data.size());
+    // replaces the blob rather than modifying it, since it may be shared
+    data = blob_store::get().intern(vector<string>(first, new_data.cend()));
+    for (const auto& [dir, name] : names)
+        watch_hub::get().publish(event_kind::MODIFY, dir, name, this);
+}
+
+void plain_file::add_name(base_file* dir, const string& name) {
+    names.emplace_back(dir, name);
+}
+
+void plain_file::drop_name(base_file* dir, const string& name) {
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        if (it->first == dir && it->second == name) {
+            names.erase(it);
+            return;
+        }
+    }
 }
 
 size_t directory::size() const { return dirents.size(); }
@@ -103,21 +387,95 @@ void directory::remove(const ptr_map::iterator file, bool recursive) {
     if (dynamic_pointer_cast<directory>(file->second->get_contents()) &&
         !recursive)
         throw file_error("rm: " + file->first + ": is a directory");
+    const string name = file->first;
+    base_file_ptr contents = file->second->get_contents();
+    if (auto plain = dynamic_pointer_cast<plain_file>(contents))
+        plain->drop_name(this, name);
+    file->second->drop_link();
     dirents.erase(file);
+    watch_hub::get().publish(event_kind::REMOVE, this, name, contents.get());
+}
+
+void directory::link(const string& name, inode_ptr node) {
+    if (!dirents.emplace(name, node).second)
+        throw file_error(name + ": File exists");
+    node->add_link();
+    base_file_ptr contents = node->get_contents();
+    if (auto plain = dynamic_pointer_cast<plain_file>(contents))
+        plain->add_name(this, name);
+    watch_hub::get().publish(event_kind::CREATE, this, name, contents.get());
+}
+
+void directory::rename(const ptr_map::iterator itor, base_file_ptr dest,
+                       const string& new_name) {
+    ptr_map& dest_dirents = dest->get_dirents();
+    if (dest_dirents.count(new_name) > 0)
+        throw file_error(new_name + ": File exists");
+    const string old_name = itor->first;
+    inode_ptr node = itor->second;
+    base_file_ptr contents = node->get_contents();
+    // relink the map node itself, so the subtree below is never touched
+    auto handle = dirents.extract(itor);
+    handle.key() = new_name;
+    dest_dirents.insert(move(handle));
+    if (auto plain = dynamic_pointer_cast<plain_file>(contents)) {
+        plain->drop_name(this, old_name);
+        plain->add_name(dest.get(), new_name);
+    } else if (dest.get() != this) {
+        inode_ptr& parent = contents->get_dirents().at("..");
+        parent->drop_link();
+        parent = dest_dirents.at(".");
+        parent->add_link();
+    }
+    watch_hub::get().publish(event_kind::REMOVE, this, old_name,
+                             contents.get());
+    watch_hub::get().publish(event_kind::CREATE, dest.get(), new_name,
+                             contents.get());
 }
 
 inode_ptr directory::mkdir(const string& dirname) {
     inode_ptr new_dir = make_shared<inode>(file_type::DIRECTORY_TYPE);
-    dirents.emplace(dirname, new_dir);
-    new_dir->get_contents()->get_dirents().emplace(".", new_dir);
-    new_dir->get_contents()->get_dirents().emplace("..", dirents.at("."));
+    link(dirname, new_dir);
+    new_dir->get_contents()->link(".", new_dir);
+    new_dir->get_contents()->link("..", dirents.at("."));
     return new_dir;
 }
 
 inode_ptr directory::mkfile(const string& filename) {
+    auto it = dirents.find(filename);
+    if (it != dirents.end()) {
+        it->second->get_contents()->readfile(); // throws if a directory
+        return it->second;
+    }
     inode_ptr new_file = make_shared<inode>(file_type::PLAIN_TYPE);
-    dirents.emplace(filename, new_file);
+    link(filename, new_file);
     return new_file;
 }
 
 ptr_map& directory::get_dirents() { return dirents; }
+
+dir_stream::dir_stream(inode_ptr dir_node, const string& after)
+    : dir(dir_node->get_contents()) {
+    dir->get_dirents(); // throws if dir_node is a plain_file
+    seek(after);
+}
+
+const ptr_map::value_type* dir_stream::readdir() {
+    const ptr_map& dirents = dir->get_dirents();
+    // resume just past the cursor, even if it has since been removed
+    auto it = started ? dirents.upper_bound(cursor) : dirents.begin();
+    if (it == dirents.end())
+        return nullptr;
+    cursor = it->first;
+    started = true;
+    return &*it;
+}
+
+const string& dir_stream::tell() const { return cursor; }
+
+void dir_stream::seek(const string& after) {
+    cursor = after;
+    started = !after.empty();
+}
+
+void dir_stream::rewind() { seek(""); }
@@ -1,10 +1,14 @@
 #ifndef __FILE_SYS_H__
 #define __FILE_SYS_H__
 
+#include <cstdio>
 #include <exception>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "util.h"
@@ -12,12 +16,15 @@
 using namespace std;
 
 enum class file_type { PLAIN_TYPE, DIRECTORY_TYPE };
+enum class residency { RESIDENT, COMPRESSED, SPILLED };
 class inode;
 class base_file;
 class plain_file;
 class directory;
+class blob;
 using inode_ptr = shared_ptr<inode>;
 using base_file_ptr = shared_ptr<base_file>;
+using blob_ptr = shared_ptr<const blob>;
 using ptr_map = map<string, inode_ptr>;
 
 class inode_state {
@@ -36,6 +43,8 @@ class inode_state {
     void set_cwd(inode_ptr new_cwd);
     void cwd_push(const string& filepath);
     void cwd_pop(bool empty);
+    void cwd_relink(inode_ptr moved, const vector<string>& new_path);
+    const vector<string>& get_cwd_path() const;
     const string cwd_str() const;
 };
 
@@ -43,11 +52,15 @@ class inode {
   private:
     static size_t next_inode_num;
     size_t inode_num;
+    size_t links{0};
     base_file_ptr contents;
 
   public:
     inode(file_type);
     size_t get_inode_num() const;
+    size_t get_links() const;
+    void add_link();
+    void drop_link();
     base_file_ptr get_contents() const;
 };
 
@@ -69,23 +82,112 @@ class base_file {
     virtual const vector<string>& readfile() const;
     virtual void writefile(const vector<string>&);
     virtual void remove(const ptr_map::iterator, bool);
+    virtual void link(const string&, inode_ptr);
+    virtual void rename(const ptr_map::iterator, base_file_ptr, const string&);
     virtual inode_ptr mkdir(const string&);
     virtual inode_ptr mkfile(const string&);
     virtual ptr_map& get_dirents();
 };
 
+/**
+ * @brief immutable file contents, shared by every plain_file with the same
+ * words; a write builds a new blob rather than modifying this one. Under a
+ * memory budget the words of a cold blob may be compressed or spilled to
+ * disk, and are faulted back in by get_words.
+ */
+class blob : public enable_shared_from_this<blob> {
+    friend class blob_store;
+
+  private:
+    mutable vector<string> words;
+    const size_t hash;
+    size_t bytes{0};
+    bool indexed{false}; // false only for the shared empty blob
+    mutable residency state{residency::RESIDENT};
+    mutable bool referenced{true};  // CLOCK reference bit
+    mutable string packed;          // compressed words, if not resident
+    mutable size_t packed_size{0};  // length of packed, even once spilled
+    mutable long spill_offset{-1};  // position in the spill file, once written
+    mutable list<const blob*>::iterator list_pos; // in the list for state
+
+  public:
+    blob(vector<string>&& new_words, size_t words_hash);
+    ~blob();
+    blob(const blob&) = delete;
+    blob& operator=(const blob&) = delete;
+    const vector<string>& get_words() const;
+    size_t get_hash() const;
+    size_t get_bytes() const;
+};
+
+/**
+ * @brief content-addressed index of every live blob; with deduplication on
+ * (it is off by default), files with identical contents share one blob. It
+ * also enforces the memory budget: once resident contents exceed
+ * resident_budget, a CLOCK sweep compresses cold blobs, and once compressed
+ * contents exceed compressed_budget, they are spilled to an anonymous
+ * temporary file.
+ */
+class blob_store {
+  private:
+    unordered_multimap<size_t, const blob*> blobs;
+    bool dedup{false};
+    list<const blob*> clock; // CLOCK ring of resident blobs only
+    list<const blob*>::iterator hand{clock.end()};
+    list<const blob*> packed_blobs; // oldest first, so spilled first
+    list<const blob*> spilled_blobs;
+    size_t resident_budget{numeric_limits<size_t>::max()};
+    size_t compressed_budget{numeric_limits<size_t>::max()};
+    size_t resident_bytes{0};
+    size_t compressed_bytes{0};
+    size_t spilled_bytes{0};
+    unique_ptr<FILE, int (*)(FILE*)> spill_file{nullptr, fclose};
+    multimap<size_t, long> free_extents; // unused spill file space, by size
+    blob_store() = default;
+    long claim_extent(size_t size);
+    void release_extent(long offset, size_t size);
+    list<const blob*>& list_for(residency state);
+    void set_state(const blob* changed, residency state);
+    const blob* advance_hand();
+    void pack(const blob* cold);
+    bool spill(const blob* cold);
+    void enforce_budget(const blob* pinned);
+
+  public:
+    static blob_store& get();
+    static blob_ptr empty();
+    blob_ptr intern(vector<string>&& words);
+    void forget(const blob* old_blob);
+    void fault_in(const blob* cold);
+    bool get_dedup() const;
+    void set_dedup(bool enabled);
+    void set_budget(size_t resident, size_t compressed);
+    size_t get_resident_budget() const;
+    size_t get_compressed_budget() const;
+    size_t blob_count() const;
+    size_t stored_bytes() const;
+    size_t logical_bytes() const;
+    size_t get_resident_bytes() const;
+    size_t get_compressed_bytes() const;
+    size_t get_spilled_bytes() const;
+};
+
 class plain_file : public base_file {
   private:
-    vector<string> data;
+    blob_ptr data;
+    vector<pair<base_file*, string>> names; // every link, for watch events
     virtual const string& error_file_type() const override {
         static const string file_type = "plain_file";
         return file_type;
     }
 
   public:
+    plain_file();
     virtual size_t size() const override;
     virtual const vector<string>& readfile() const override;
     virtual void writefile(const vector<string>& new_data) override;
+    void add_name(base_file* dir, const string& name);
+    void drop_name(base_file* dir, const string& name);
 };
 
 class directory : public base_file {
@@ -99,9 +201,33 @@ class directory : public base_file {
   public:
     virtual size_t size() const override;
     virtual void remove(const ptr_map::iterator itor, bool recursive) override;
+    virtual void link(const string& name, inode_ptr node) override;
+    virtual void rename(const ptr_map::iterator itor, base_file_ptr dest,
+                        const string& new_name) override;
     virtual inode_ptr mkdir(const string& dirname) override;
     virtual inode_ptr mkfile(const string& filename) override;
     virtual ptr_map& get_dirents() override;
 };
 
+/**
+ * @brief an opendir/readdir-style cursor over the entries of a directory
+ *
+ * The cursor is the name of the last entry returned, so a stream stays valid
+ * across inserts and removes in the directory and can be resumed later by
+ * seeking to a saved name. Each readdir costs O(log n) in the directory size.
+ */
+class dir_stream {
+  private:
+    base_file_ptr dir;
+    string cursor;
+    bool started{false};
+
+  public:
+    dir_stream(inode_ptr dir_node, const string& after = "");
+    const ptr_map::value_type* readdir();
+    const string& tell() const;
+    void seek(const string& after);
+    void rewind();
+};
+
 #endif
@@ -0,0 +1,86 @@
+#include <stdexcept>
+
+using namespace std;
+
+#include "file_sys.h"
+#include "notify.h"
+
+bool fs_event::operator==(const fs_event& that) const {
+    return kind == that.kind && dir_inode_num == that.dir_inode_num &&
+           name == that.name;
+}
+
+const string& event_name(event_kind kind) {
+    static const string names[] = {"create", "remove", "modify"};
+    return names[static_cast<size_t>(kind)];
+}
+
+watch_hub& watch_hub::get() {
+    static watch_hub hub;
+    return hub;
+}
+
+size_t watch_hub::subscribe(shared_ptr<inode> target, bool recursive) {
+    auto sub = make_unique<subscription>();
+    sub->target = target;
+    sub->target_inode_num = target->get_inode_num();
+    sub->recursive = recursive;
+    subscriptions.emplace(next_id, move(sub));
+    return next_id++;
+}
+
+void watch_hub::unsubscribe(size_t id) {
+    if (subscriptions.erase(id) == 0)
+        throw out_of_range(to_string(id));
+}
+
+vector<size_t> watch_hub::list() const {
+    vector<size_t> ids;
+    for (const auto& [id, sub] : subscriptions)
+        ids.push_back(id);
+    return ids;
+}
+
+size_t watch_hub::get_target_inode_num(size_t id) const {
+    return subscriptions.at(id)->target_inode_num;
+}
+
+bool watch_hub::is_recursive(size_t id) const {
+    return subscriptions.at(id)->recursive;
+}
+
+bool watch_hub::poll(size_t id, fs_event& event) {
+    return subscriptions.at(id)->queue.pop(event);
+}
+
+bool watch_hub::take_overflow(size_t id) {
+    return subscriptions.at(id)->queue.take_overflow();
+}
+
+void watch_hub::publish(event_kind kind, base_file* dir, const string& name,
+                        const base_file* entry) {
+    if (subscriptions.empty() || name == "." || name == "..")
+        return;
+    // '.' outlives every other entry, since rm removes it last
+    fs_event event{kind, dir->get_dirents().at(".")->get_inode_num(), name};
+    for (auto& [id, sub] : subscriptions) {
+        shared_ptr<inode> target_node = sub->target.lock();
+        if (target_node == nullptr)
+            continue; // the watched file is gone
+        const base_file* target = target_node->get_contents().get();
+        bool matched = target == entry;
+        // walk up through '..' until the watched directory or the root
+        for (base_file* up = dir; !matched && up != nullptr;) {
+            matched = up == target;
+            if (!sub->recursive)
+                break;
+            auto parent = up->get_dirents().find("..");
+            if (parent == up->get_dirents().end() ||
+                parent->second->get_contents().get() == up)
+                break;
+            up = parent->second->get_contents().get();
+        }
+        if (matched)
+            sub->queue.push(event);
+    }
+}
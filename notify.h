@@ -0,0 +1,138 @@
+#ifndef __NOTIFY_H__
+#define __NOTIFY_H__
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+class inode;
+class base_file;
+
+enum class event_kind { CREATE, REMOVE, MODIFY };
+
+/**
+ * @brief a change to one entry of a directory
+ */
+struct fs_event {
+    event_kind kind;
+    size_t dir_inode_num;
+    string name;
+    bool operator==(const fs_event& that) const;
+};
+
+/**
+ * @brief name of an event kind, for printing
+ *
+ * @param kind the event kind
+ * @return const string& lower-case name, e.g. "create"
+ */
+const string& event_name(event_kind kind);
+
+/**
+ * @brief a bounded single-producer single-consumer queue; push and pop never
+ * block or lock, so a consumer may drain it from another thread
+ *
+ * @tparam T element type
+ * @tparam capacity number of slots, a power of two
+ */
+template <typename T, size_t capacity> class event_ring {
+    static_assert((capacity & (capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+  private:
+    array<T, capacity> slots;
+    atomic<size_t> head{0}; // next slot to pop, written by the consumer
+    atomic<size_t> tail{0}; // next slot to push, written by the producer
+    atomic<bool> overflowed{false};
+    // producer-private copy of the newest item, so coalescing never reads a
+    // slot the consumer may own
+    T last{};
+    size_t last_pos{0};
+    bool has_last{false};
+
+  public:
+    /**
+     * @brief appends an item, unless it repeats the newest item that the
+     * consumer has not started reading yet
+     *
+     * @return false if the queue was full and the item was dropped
+     */
+    bool push(const T& item) {
+        size_t back = tail.load(memory_order_relaxed);
+        size_t front = head.load(memory_order_acquire);
+        // the consumer only starts on slot last_pos once head reaches it, so
+        // it will read the merged item after this change happened
+        if (has_last && front < last_pos && last == item)
+            return true; // coalesced
+        if (back - front == capacity) {
+            overflowed.store(true, memory_order_release);
+            return false;
+        }
+        slots[back % capacity] = item;
+        tail.store(back + 1, memory_order_release);
+        last = item;
+        last_pos = back;
+        has_last = true;
+        return true;
+    }
+
+    /**
+     * @brief removes the oldest item
+     *
+     * @return false if the queue was empty
+     */
+    bool pop(T& item) {
+        size_t front = head.load(memory_order_relaxed);
+        if (front == tail.load(memory_order_acquire))
+            return false;
+        item = move(slots[front % capacity]);
+        head.store(front + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief reports and clears whether any item was dropped since the last
+     * call
+     */
+    bool take_overflow() {
+        return overflowed.exchange(false, memory_order_acq_rel);
+    }
+};
+
+/**
+ * @brief registry of watches; directory and plain_file mutations publish
+ * events here, and each matching watch gets a copy in its own queue
+ */
+class watch_hub {
+  public:
+    static const size_t QUEUE_SIZE = 256;
+
+  private:
+    struct subscription {
+        weak_ptr<inode> target; // must not keep files alive past shutdown
+        size_t target_inode_num;
+        bool recursive;
+        event_ring<fs_event, QUEUE_SIZE> queue;
+    };
+    map<size_t, unique_ptr<subscription>> subscriptions;
+    size_t next_id{1};
+    watch_hub() = default;
+
+  public:
+    static watch_hub& get();
+    size_t subscribe(shared_ptr<inode> target, bool recursive);
+    void unsubscribe(size_t id);
+    vector<size_t> list() const;
+    size_t get_target_inode_num(size_t id) const;
+    bool is_recursive(size_t id) const;
+    bool poll(size_t id, fs_event& event);
+    bool take_overflow(size_t id);
+    void publish(event_kind kind, base_file* dir, const string& name,
+                 const base_file* entry);
+};
+
+#endif